@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
 #include "BlockMemoryPool.h"
 #include "EcsTypes.h"
 
@@ -19,6 +22,7 @@ public:
         if (!m_freeIndices.empty()) {
             index = m_freeIndices.back();
             m_freeIndices.pop_back();
+            m_freeSortedCount = std::min(m_freeSortedCount, static_cast<uint32_t>(m_freeIndices.size()));
         }
         else {
             index = m_size;
@@ -29,6 +33,14 @@ public:
         return index;
     }
 
+    // Creates count copies of prototype in contiguous indices and returns the first index.
+    // Reuses a run of free indices when one is long enough, otherwise grows the pool.
+    uint32_t CreateCopies (uint32_t count, const T& prototype) {
+        const uint32_t first = AcquireRun(count);
+        CopyConstruct(first, count, prototype, std::is_trivially_copyable<T>{});
+        return first;
+    }
+
     T& GetObject (uint32_t index) {
         return *static_cast<T*>(BlockMemoryPool::Get(index));
     }
@@ -45,8 +57,78 @@ public:
     }
 
 private:
+    // Removes count contiguous indices from the free list, or appends them to the pool.
+    uint32_t AcquireRun (uint32_t count) {
+        const uint32_t freeCount = static_cast<uint32_t>(m_freeIndices.size());
+        if (count == 0 || count > freeCount) {
+            const uint32_t first = m_size;
+            m_size += count;
+            Reserve(m_size);
+            return first;
+        }
+        SortFreeIndices();
+        uint32_t runStart = 0;
+        for (uint32_t i = 0; i < freeCount; ++i) {
+            if (i > runStart && m_freeIndices[i] != m_freeIndices[i - 1] + 1) {
+                runStart = i;
+            }
+            if (i - runStart + 1 == count) {
+                const uint32_t first = m_freeIndices[runStart];
+                m_freeIndices.erase(m_freeIndices.begin() + runStart, m_freeIndices.begin() + i + 1);
+                m_freeSortedCount = static_cast<uint32_t>(m_freeIndices.size());
+                return first;
+            }
+        }
+
+        // No run is long enough, so extend the free run at the end of the pool (if any).
+        uint32_t tailCount = 0;
+        while (tailCount < freeCount && m_freeIndices[freeCount - 1 - tailCount] == m_size - 1 - tailCount) {
+            ++tailCount;
+        }
+        m_freeIndices.resize(freeCount - tailCount);
+        m_freeSortedCount = static_cast<uint32_t>(m_freeIndices.size());
+        const uint32_t first = m_size - tailCount;
+        m_size = first + count;
+        Reserve(m_size);
+        return first;
+    }
+
+    // Sorts only the indices freed since the last sort and merges them into the sorted prefix.
+    void SortFreeIndices () {
+        if (m_freeSortedCount == m_freeIndices.size()) {
+            return;
+        }
+        const auto sortedEnd = m_freeIndices.begin() + m_freeSortedCount;
+        std::sort(sortedEnd, m_freeIndices.end());
+        std::inplace_merge(m_freeIndices.begin(), sortedEnd, m_freeIndices.end());
+        m_freeSortedCount = static_cast<uint32_t>(m_freeIndices.size());
+    }
+
+    void CopyConstruct (uint32_t first, uint32_t count, const T& prototype, std::false_type) {
+        for (uint32_t i = first; i < first + count; ++i) {
+            new (Get(i)) T(prototype);
+        }
+    }
+
+    // Fill each block span by doubling memcpy from the already copied prefix.
+    void CopyConstruct (uint32_t first, uint32_t count, const T& prototype, std::true_type) {
+        while (count > 0) {
+            const uint32_t spanCount = std::min(count, GetBlockSize() - first % GetBlockSize());
+            char* span = static_cast<char*>(Get(first));
+            std::memcpy(span, &prototype, sizeof(T));
+            for (uint32_t copied = 1; copied < spanCount; copied *= 2) {
+                std::memcpy(span + copied * sizeof(T), span, std::min(copied, spanCount - copied) * sizeof(T));
+            }
+            first += spanCount;
+            count -= spanCount;
+        }
+    }
+
     uint32_t m_size{0};
     std::vector<uint32_t> m_freeIndices{};
+
+    // m_freeSortedCount is the length of the sorted prefix of m_freeIndices.
+    uint32_t m_freeSortedCount{0};
 };
 
 }
\ No newline at end of file
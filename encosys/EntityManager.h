@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <bitset>
+#include <cstring>
+#include <numeric>
 #include <memory>
 #include <type_traits>
 #include <unordered_map>
@@ -11,16 +14,42 @@
 #include "Entity.h"
 #include "System.h"
 #include "FunctionTraits.h"
+#include "Prefab.h"
+#include "Parallel.h"
+#include "Resource.h"
+#include "SpatialGrid.h"
 
 namespace ECS {
 
-template <typename TComponentList>
+template <typename TComponentList, typename TResourceList = TypeList<>>
 class EntityManager {
 private:
-    using ComponentMask = std::bitset<TComponentList::Size>;
+    // The two extra bits of an entity's mask are its enabled bit, which every query also requires,
+    // and its spatial moved bit, which no query looks at.
+    using ComponentMask = std::bitset<TComponentList::Size + 2>;
     using ComponentIndexCard = std::array<uint32_t, TComponentList::Size>;
     using ComponentPools = typename TComponentList::template WrapTypes<BlockObjectPool>::ListTuple;
+    using Resources = typename TResourceList::ListTuple;
     using SystemCallback = std::function<void(float)>;
+    using ObserverCallback = std::function<void(const std::vector<Entity>&)>;
+    using ComponentObservers = std::array<std::vector<ObserverCallback>, TComponentList::Size>;
+    using ComponentEvents = std::array<std::vector<Entity>, TComponentList::Size>;
+    // SortKey is (missing component, encoded key), so entities without the component order last.
+    using SortKey = std::pair<bool, uint64_t>;
+    using SortKeyCallback = std::function<SortKey(uint32_t)>;
+    using SpatialPointCallback = std::function<SpatialPoint(uint32_t)>;
+
+    // Param lists of a ForEach callback, whose first param must be the entity
+    template <typename TFunc>
+    struct CallbackArgs {
+        using Traits = FunctionTraits<TFunc>;
+        static_assert(Traits::ArgCount > 0, "First callback param must be ECS::Entity.");
+        static_assert(std::is_same<typename Traits::template Arg<0>, Entity>::value, "First callback param must be ECS::Entity.");
+        using Args = typename Traits::Args::RemoveFirst;
+        using ComponentArgs = typename Args::template Filter<IsComponentArg>;
+        using ResourceArgs = typename Args::template Filter<IsResourceArg>;
+        using Seq = typename GenerateSequence<(Traits::ArgCount > 0) ? Traits::ArgCount - 1 : 0>::Type;
+    };
 
 public:
     EntityManager () = default;
@@ -30,17 +59,79 @@ public:
     void Destroy (const Entity& id);
     bool IsActive (const Entity& id) const;
     void SetActive (const Entity& id, bool active);
+
+    // Disabled entities keep their position but are skipped by every query. Unlike SetActive,
+    // toggling only flips a single bit, so it is the cheaper choice for frequent toggles.
+    bool IsEnabled (const Entity& id) const;
+    void SetEnabled (const Entity& id, bool enabled);
     bool IsValid (const Entity& id) const;
 
+    // Creates count entities holding copies of the prefab's components.
+    template <typename... TComponents>
+    std::vector<Entity> Instantiate (const Prefab<TComponents...>& prefab, uint32_t count, bool active = true);
+
     template <typename TComponent, typename... TArgs>
     void AddComponent(const Entity& id, TArgs&&... args);
 
     template <typename TComponent>
     TComponent& GetComponent (const Entity& id);
 
+    // Same as GetComponent, but also marks the entity as moved if TComponent is spatially indexed.
+    template <typename TComponent>
+    TComponent& ModifyComponent (const Entity& id);
+
     template <typename TComponent>
     void RemoveComponent (const Entity& id);
 
+    template <typename TResource>
+    TResource& GetResource ();
+
+    // Observers receive every entity that gained/lost TComponent since the last FlushEvents().
+    // Entities are delivered as ids only, so they may have since been destroyed or changed again.
+    template <typename TComponent>
+    void OnAdd (ObserverCallback observer);
+
+    template <typename TComponent>
+    void OnRemove (ObserverCallback observer);
+
+    void FlushEvents ();
+
+    // Keeps active entities ordered by key(const TComponent&) so ForEach visits them in key order,
+    // with equal keys grouped together. The key must be an integral or floating point value.
+    // Entities without TComponent are ordered last.
+    // Order is restored by SortEntities(), which RunSystems calls before running systems.
+    template <typename TComponent, typename TKeyFunc>
+    void SetSortKey (TKeyFunc&& key);
+
+    void ClearSortKey ();
+    void SortEntities ();
+
+    // Indexes every entity with TPosition in a uniform grid, using toPoint(const TPosition&) as its point.
+    // Adding/removing TPosition and destroying entities update the index immediately. Writes to
+    // TPosition are applied by UpdateSpatialIndex(id) right away, or recorded by MarkMoved(id),
+    // ModifyComponent and ForEach callbacks taking TPosition& and applied by RefreshSpatialIndex(),
+    // which RunSystems calls before each system and after the last. RebuildSpatialIndex() rescans everything,
+    // calling toPoint from threadCount threads, so toPoint must be safe to call concurrently.
+    template <typename TPosition, typename TPointFunc>
+    void EnableSpatialIndex (float cellSize, TPointFunc&& toPoint);
+
+    void DisableSpatialIndex ();
+    void UpdateSpatialIndex (const Entity& id);
+    void MarkMoved (const Entity& id);
+    void RefreshSpatialIndex ();
+    void RebuildSpatialIndex (uint32_t threadCount = 1);
+
+    // Spatial queries append matching entities, active or not, to result.
+    void QueryRadius (const SpatialPoint& center, float radius, std::vector<Entity>& result) const;
+    void QueryBounds (const SpatialBounds& bounds, std::vector<Entity>& result) const;
+
+    // Same as ForEach, restricted to active entities found by the matching spatial query.
+    template <typename TFunc>
+    void ForEachInRadius (const SpatialPoint& center, float radius, TFunc&& callback);
+
+    template <typename TFunc>
+    void ForEachInBounds (const SpatialBounds& bounds, TFunc&& callback);
+
     template <typename TFunc>
     void ForEach (TFunc&& callback);
 
@@ -71,29 +162,133 @@ private:
     // m_componentPools contains the memory pools for each component type.
     ComponentPools m_componentPools{};
 
+    // m_resources contains the single world-level instance of each resource type.
+    Resources m_resources{};
+
     // m_systems contains the list of registered system callbacks.
     std::vector<SystemCallback> m_systems{};
 
+    // m_addObservers and m_removeObservers contain the observer callbacks for each component type.
+    ComponentObservers m_addObservers{};
+    ComponentObservers m_removeObservers{};
+
+    // m_pendingAddObservers and m_pendingRemoveObservers buffer observers registered while dispatching,
+    // so the observer lists never change during dispatch. They are appended once dispatch finishes.
+    ComponentObservers m_pendingAddObservers{};
+    ComponentObservers m_pendingRemoveObservers{};
+
+    // m_dispatchBatches holds the batches being delivered, swapped out of m_addEvents/m_removeEvents
+    // so events queued during dispatch wait for the next flush.
+    ComponentEvents m_dispatchBatches{};
+
+    // m_dispatching is true while FlushEvents is delivering events.
+    bool m_dispatching{false};
+
+    // m_addEvents and m_removeEvents contain the queued entities for each observed component type.
+    // Events are only queued for component types that have at least one observer, or while dispatching.
+    ComponentEvents m_addEvents{};
+    ComponentEvents m_removeEvents{};
+
+    // m_sortKey computes the sort key for the entity at a given index, if a sort key is set.
+    SortKeyCallback m_sortKey{};
+
+    // m_sortKeys is scratch space holding the sort key of each active entity during SortEntities.
+    std::vector<SortKey> m_sortKeys{};
+
+    // m_spatialGrid is the spatial index over m_spatialComponentIndex, if one is enabled.
+    std::unique_ptr<SpatialGrid> m_spatialGrid{};
+    std::size_t m_spatialComponentIndex{};
+
+    // m_spatialPoint computes the spatial index point for the entity at a given index.
+    SpatialPointCallback m_spatialPoint{};
+
+    // m_spatialMoved contains the entities marked as moved since the last spatial index refresh.
+    // Each is queued once, guarded by the c_spatialMovedBit of its mask.
+    std::vector<Entity> m_spatialMoved{};
+
     // m_entityActiveCount is the number of entities that are currently active.
     // Active entities are packed together at the beginning of the m_componentMasks array.
     uint32_t m_entityActiveCount{0};
 
 private:
 
+    // c_enabledBit is the index of the enabled bit in each ComponentMask.
+    static constexpr std::size_t c_enabledBit = TComponentList::Size;
+
+    // c_spatialMovedBit is the index of the bit in each ComponentMask set while the entity is in m_spatialMoved.
+    static constexpr std::size_t c_spatialMovedBit = TComponentList::Size + 1;
+
     template <typename TComponent>
     static constexpr std::size_t GetComponentIndex ();
 
+    // Mask for a new entity with no components
+    static ComponentMask NewEntityMask ();
+
+    // Mask that a ForEach callback's component params require, checked against registered components
+    template <typename TComponentArgs>
+    static ComponentMask MakeTargetMask ();
+
+    // Whether a ForEach callback takes the spatially indexed component by non-const reference
+    template <typename TComponentArgs>
+    bool WritesSpatialComponent () const;
+
+    // Sort key encoding into an unsigned value with the same ordering
+    template <typename TKey>
+    static uint64_t EncodeSortKey (TKey key, std::false_type);
+
+    template <typename TKey>
+    static uint64_t EncodeSortKey (TKey key, std::true_type);
+
     // Component pools
     template <typename TComponent>
     BlockObjectPool<std::decay_t<TComponent>>& GetComponentPool ();
 
+    // Resource handles, resolved once per ForEach
+    template <typename... Args>
+    std::tuple<std::decay_t<Args>...> MakeResourceArgs (TypeList<Args...>);
+
+    template <typename TArg>
+    Res<TArg> MakeResourceArg (Res<TArg>*);
+
+    template <typename TArg>
+    ResMut<TArg> MakeResourceArg (ResMut<TArg>*);
+
+    // Callback param helpers, Position is the index of the param within TArgs
+    template <typename TArgs, std::size_t Position, typename TResourceArgs>
+    auto GetCallbackArg (const ComponentIndexCard& indexCard, TResourceArgs& resourceArgs, std::false_type);
+
+    template <typename TArgs, std::size_t Position, typename TResourceArgs>
+    auto GetCallbackArg (const ComponentIndexCard& indexCard, TResourceArgs& resourceArgs, std::true_type);
+
     // ForEach helper
-    template <typename TFunc, typename... Args, std::size_t... Seq>
-    void UnpackAndCallback (uint32_t entityIndex, TFunc&& callback, TypeList<Args...>, Sequence<Seq...>);
+    template <typename TFunc, typename TResourceArgs, typename... Args, std::size_t... Seq>
+    void UnpackAndCallback (uint32_t entityIndex, TFunc&& callback, TResourceArgs& resourceArgs, TypeList<Args...>, Sequence<Seq...>);
 
     // ForEachMember helper
-    template <typename TObject, typename TFunc, typename... Args, std::size_t... Seq>
-    void UnpackAndCallbackMember (TObject* self, uint32_t entityIndex, TFunc&& callback, TypeList<Args...>, Sequence<Seq...>);
+    template <typename TObject, typename TFunc, typename TResourceArgs, typename... Args, std::size_t... Seq>
+    void UnpackAndCallbackMember (TObject* self, uint32_t entityIndex, TFunc&& callback, TResourceArgs& resourceArgs, TypeList<Args...>, Sequence<Seq...>);
+
+    // Instantiate helper
+    uint32_t InsertEntityRows (uint32_t count, bool active);
+
+    // Sort helpers
+    bool InsertionSortEntities (uint32_t maxSwaps);
+    void PermuteSortEntities ();
+
+    // Spatial index helpers
+    void SpatialIndexInsert (uint32_t index, std::size_t componentIndex);
+    void SpatialIndexRemove (uint32_t index, std::size_t componentIndex);
+    void MarkIndexMoved (uint32_t index);
+    void ClearSpatialMoved ();
+
+    template <typename TFunc>
+    void ForEachOf (const std::vector<Entity>& ids, TFunc&& callback);
+
+    // Observer helpers
+    void QueueEvent (ComponentEvents& events, const ComponentObservers& observers, std::size_t componentIndex, const Entity& id);
+    void AddObserver (ComponentObservers& observers, ComponentObservers& pendingObservers, std::size_t componentIndex, ObserverCallback observer);
+    void AppendPendingObservers (ComponentObservers& observers, ComponentObservers& pendingObservers);
+    void DispatchEvents (ComponentEvents& events, const ComponentObservers& observers);
 
     // Index helpers
     bool IndexIsActive (uint32_t index) const;
@@ -103,22 +298,25 @@ private:
     void SwapEntities (uint32_t lhsIndex, uint32_t rhsIndex);
 };
 
-template <typename TComponentList>
-EntityManager<TComponentList>::~EntityManager() {
-    for (uint32_t i = 0; i < m_entities.size(); ++i) {
-        Destroy(m_entities[i]);
+template <typename TComponentList, typename TResourceList>
+EntityManager<TComponentList, TResourceList>::~EntityManager() {
+    // Destroy swaps the entity to the back before popping it, so always destroy from the back.
+    while (!m_entities.empty()) {
+        const Entity id = m_entities.back();
+        Destroy(id);
     }
+    FlushEvents();
 }
 
-template <typename TComponentList>
-Entity EntityManager<TComponentList>::Create (bool active) {
+template <typename TComponentList, typename TResourceList>
+Entity EntityManager<TComponentList, TResourceList>::Create (bool active) {
     Entity id{ m_entityIdCounter };
     ++m_entityIdCounter;
 
     if (active) {
         if (m_entityActiveCount == m_entities.size()) {
             m_entityMap[id] = m_entities.size();
-            m_componentMasks.push_back({});
+            m_componentMasks.push_back(NewEntityMask());
             m_componentIndexCards.push_back({});
             m_entities.push_back(id);
         }
@@ -129,7 +327,7 @@ Entity EntityManager<TComponentList>::Create (bool active) {
             m_entities.push_back(m_entities[m_entityActiveCount]);
 
             m_entityMap[id] = m_entityActiveCount;
-            m_componentMasks[m_entityActiveCount].reset();
+            m_componentMasks[m_entityActiveCount] = NewEntityMask();
             m_componentIndexCards[m_entityActiveCount] = {};
             m_entities[m_entityActiveCount] = id;
         }
@@ -137,7 +335,7 @@ Entity EntityManager<TComponentList>::Create (bool active) {
     }
     else {
         m_entityMap[id] = m_entities.size();
-        m_componentMasks.push_back({});
+        m_componentMasks.push_back(NewEntityMask());
         m_componentIndexCards.push_back({});
         m_entities.push_back(id);
     }
@@ -145,20 +343,22 @@ Entity EntityManager<TComponentList>::Create (bool active) {
     return id;
 }
 
-template <typename TComponentList>
-void EntityManager<TComponentList>::Destroy (const Entity& id) {
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::Destroy (const Entity& id) {
     auto entityIter = m_entityMap.find(id);
     ECS_ASSERT_(entityIter != m_entityMap.cend());
 
     auto index = entityIter->second;
     auto& mask = m_componentMasks[index];
     auto& indexCard = m_componentIndexCards[index];
-    TComponentList::ForTypes([this, &mask, &indexCard](auto t) {
+    TComponentList::ForTypes([this, &id, &mask, &indexCard](auto t) {
         (void)t;
         if (mask.test(TComponentList::IndexOf<TYPE_OF(t)>())) {
             std::get<TComponentList::IndexOf<TYPE_OF(t)>()>(m_componentPools).Destroy(indexCard[TComponentList::IndexOf<TYPE_OF(t)>()]);
+            QueueEvent(m_removeEvents, m_removeObservers, TComponentList::IndexOf<TYPE_OF(t)>(), id);
         }
     });
+    SpatialIndexRemove(index, m_spatialComponentIndex);
     IndexSetActive(index, false);
     // Swap this entity to the end so we can destroy it.
     if (index < m_entities.size() - 1) {
@@ -170,35 +370,80 @@ void EntityManager<TComponentList>::Destroy (const Entity& id) {
     m_entities.pop_back();
 }
 
-template <typename TComponentList>
-bool EntityManager<TComponentList>::IsActive (const Entity& id) const {
+template <typename TComponentList, typename TResourceList>
+bool EntityManager<TComponentList, TResourceList>::IsActive (const Entity& id) const {
     auto it = m_entityMap.find(id);
     return (it != m_entityMap.cend()) ? IndexIsActive(it->second) : false;
 }
 
-template <typename TComponentList>
-void EntityManager<TComponentList>::SetActive (const Entity& id, bool active) {
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::SetActive (const Entity& id, bool active) {
+    ECS_ASSERT_(IsValid(id));
     auto index = m_entityMap[id];
-    if (active == IndexIsActive(index)) {
-        return;
-    }
-    if (m_entityActiveCount < m_entities.size()) {
-        SwapEntities(index, m_entityActiveCount);
-    }
-    else {
-        SwapEntities(index, m_entities.size() - 1);
-    }
-    m_entityActiveCount += (active ? 1 : -1);
+    IndexSetActive(index, active);
+}
+
+template <typename TComponentList, typename TResourceList>
+bool EntityManager<TComponentList, TResourceList>::IsEnabled (const Entity& id) const {
+    auto it = m_entityMap.find(id);
+    return (it != m_entityMap.cend()) ? m_componentMasks[it->second].test(c_enabledBit) : false;
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::SetEnabled (const Entity& id, bool enabled) {
+    ECS_ASSERT_(IsValid(id));
+    m_componentMasks[m_entityMap[id]].set(c_enabledBit, enabled);
 }
 
-template <typename TComponentList>
-bool EntityManager<TComponentList>::IsValid (const Entity& id) const {
+template <typename TComponentList, typename TResourceList>
+bool EntityManager<TComponentList, TResourceList>::IsValid (const Entity& id) const {
     return id != c_invalidEntity && m_entityMap.find(id) != m_entityMap.cend();
 }
 
-template <typename TComponentList>
+template <typename TComponentList, typename TResourceList>
+template <typename... TComponents>
+std::vector<Entity> EntityManager<TComponentList, TResourceList>::Instantiate (const Prefab<TComponents...>& prefab, uint32_t count, bool active) {
+    // Each component type is copied into one contiguous run of its pool.
+    ComponentMask mask = NewEntityMask();
+    ComponentIndexCard indexCard{};
+    TypeList<TComponents...>::ForTypes([this, &prefab, &mask, &indexCard, count](auto t) {
+        (void)t;
+        static_assert(TComponentList::Contains<TYPE_OF(t)>(),
+            "Cannot add component of a type that has not been registered in the ECS::EntityManager");
+        mask.set(GetComponentIndex<TYPE_OF(t)>());
+        indexCard[GetComponentIndex<TYPE_OF(t)>()] = GetComponentPool<TYPE_OF(t)>().CreateCopies(count, prefab.template Get<TYPE_OF(t)>());
+    });
+
+    std::vector<Entity> ids{};
+    ids.reserve(count);
+    const uint32_t firstIndex = InsertEntityRows(count, active);
+    for (uint32_t i = firstIndex; i < firstIndex + count; ++i) {
+        Entity id{ m_entityIdCounter };
+        ++m_entityIdCounter;
+        m_entityMap[id] = i;
+        m_componentMasks[i] = mask;
+        m_componentIndexCards[i] = indexCard;
+        m_entities[i] = id;
+        ids.push_back(id);
+        SpatialIndexInsert(i, m_spatialComponentIndex);
+        TypeList<TComponents...>::ForTypes([&indexCard](auto t) {
+            (void)t;
+            ++indexCard[GetComponentIndex<TYPE_OF(t)>()];
+        });
+    }
+
+    TypeList<TComponents...>::ForTypes([this, &ids](auto t) {
+        (void)t;
+        for (const auto& id : ids) {
+            QueueEvent(m_addEvents, m_addObservers, GetComponentIndex<TYPE_OF(t)>(), id);
+        }
+    });
+    return ids;
+}
+
+template <typename TComponentList, typename TResourceList>
 template <typename TComponent, typename... TArgs>
-void EntityManager<TComponentList>::AddComponent (const Entity& id, TArgs&&... args) {
+void EntityManager<TComponentList, TResourceList>::AddComponent (const Entity& id, TArgs&&... args) {
     static_assert(TComponentList::Contains<TComponent>(),
         "Cannot add component of a type that has not been registered in the ECS::EntityManager");
     ECS_ASSERT_(IsValid(id));
@@ -209,11 +454,13 @@ void EntityManager<TComponentList>::AddComponent (const Entity& id, TArgs&&... a
     auto& pool = GetComponentPool<TComponent>();
     indexCard[GetComponentIndex<TComponent>()] = pool.Create(std::forward<TArgs>(args)...);
     mask.set(GetComponentIndex<TComponent>());
+    SpatialIndexInsert(index, GetComponentIndex<TComponent>());
+    QueueEvent(m_addEvents, m_addObservers, GetComponentIndex<TComponent>(), id);
 }
 
-template <typename TComponentList>
+template <typename TComponentList, typename TResourceList>
 template <typename TComponent>
-TComponent& EntityManager<TComponentList>::GetComponent (const Entity& id) {
+TComponent& EntityManager<TComponentList, TResourceList>::GetComponent (const Entity& id) {
     static_assert(TComponentList::Contains<TComponent>(),
         "Cannot get component of a type that has not been registered in the ECS::EntityManager");
     ECS_ASSERT_(IsValid(id));
@@ -225,9 +472,18 @@ TComponent& EntityManager<TComponentList>::GetComponent (const Entity& id) {
     return pool.GetObject(indexCard[GetComponentIndex<TComponent>()]);
 }
 
-template <typename TComponentList>
+template <typename TComponentList, typename TResourceList>
 template <typename TComponent>
-void EntityManager<TComponentList>::RemoveComponent (const Entity& id) {
+TComponent& EntityManager<TComponentList, TResourceList>::ModifyComponent (const Entity& id) {
+    if (m_spatialGrid && GetComponentIndex<TComponent>() == m_spatialComponentIndex) {
+        MarkMoved(id);
+    }
+    return GetComponent<TComponent>(id);
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TComponent>
+void EntityManager<TComponentList, TResourceList>::RemoveComponent (const Entity& id) {
     static_assert(TComponentList::Contains<TComponent>(),
         "Cannot remove component of a type that has not been registered in the ECS::EntityManager");
     ECS_ASSERT_(IsValid(id));
@@ -236,71 +492,241 @@ void EntityManager<TComponentList>::RemoveComponent (const Entity& id) {
     auto& indexCard = m_componentIndexCards[index];
     ECS_ASSERT_(mask.test(GetComponentIndex<TComponent>()) == true);
     auto& pool = GetComponentPool<TComponent>();
+    SpatialIndexRemove(index, GetComponentIndex<TComponent>());
     pool.Destroy(indexCard[GetComponentIndex<TComponent>()]);
     mask.set(GetComponentIndex<TComponent>(), false);
+    QueueEvent(m_removeEvents, m_removeObservers, GetComponentIndex<TComponent>(), id);
 }
 
-template <typename TComponentList>
-template <typename TFunc>
-void EntityManager<TComponentList>::ForEach (TFunc&& callback) {
-    using FTraits = FunctionTraits<decltype(callback)>;
-    static_assert(FTraits::ArgCount > 0, "First callback param must be ECS::Entity.");
-    static_assert(std::is_same<FTraits::Arg<0>, Entity>::value, "First callback param must be ECS::Entity.");
-    using FComponentArgs = typename FTraits::Args::RemoveFirst;
+template <typename TComponentList, typename TResourceList>
+template <typename TResource>
+TResource& EntityManager<TComponentList, TResourceList>::GetResource () {
+    static_assert(TResourceList::Contains<TResource>(),
+        "Cannot get resource of a type that has not been registered in the ECS::EntityManager");
+    return std::get<TResourceList::IndexOf<TResource>()>(m_resources);
+}
 
-    ComponentMask targetMask{};
-    FComponentArgs::ForTypes([&targetMask] (auto t) {
-        (void)t;
-        static_assert(TComponentList::Contains<std::decay_t<TYPE_OF(t)>>(),
-            "Cannot get component of a type that has not been registered in the ECS::EntityManager");
-        targetMask.set(GetComponentIndex<TYPE_OF(t)>());
+template <typename TComponentList, typename TResourceList>
+template <typename TComponent>
+void EntityManager<TComponentList, TResourceList>::OnAdd (ObserverCallback observer) {
+    static_assert(TComponentList::Contains<TComponent>(),
+        "Cannot observe component of a type that has not been registered in the ECS::EntityManager");
+    AddObserver(m_addObservers, m_pendingAddObservers, GetComponentIndex<TComponent>(), std::move(observer));
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TComponent>
+void EntityManager<TComponentList, TResourceList>::OnRemove (ObserverCallback observer) {
+    static_assert(TComponentList::Contains<TComponent>(),
+        "Cannot observe component of a type that has not been registered in the ECS::EntityManager");
+    AddObserver(m_removeObservers, m_pendingRemoveObservers, GetComponentIndex<TComponent>(), std::move(observer));
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::FlushEvents () {
+    // Observers flushing again would redeliver the batch being dispatched, so nested flushes do nothing.
+    if (m_dispatching) {
+        return;
+    }
+    m_dispatching = true;
+    DispatchEvents(m_addEvents, m_addObservers);
+    DispatchEvents(m_removeEvents, m_removeObservers);
+    m_dispatching = false;
+    AppendPendingObservers(m_addObservers, m_pendingAddObservers);
+    AppendPendingObservers(m_removeObservers, m_pendingRemoveObservers);
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TComponent, typename TKeyFunc>
+void EntityManager<TComponentList, TResourceList>::SetSortKey (TKeyFunc&& key) {
+    static_assert(TComponentList::Contains<TComponent>(),
+        "Cannot sort by component of a type that has not been registered in the ECS::EntityManager");
+    using TKey = std::decay_t<decltype(key(std::declval<const TComponent&>()))>;
+    static_assert(std::is_arithmetic<TKey>::value, "Sort key must be an integral or floating point type.");
+    m_sortKey = [this, key = std::forward<TKeyFunc>(key)](uint32_t index) -> SortKey {
+        if (!m_componentMasks[index].test(GetComponentIndex<TComponent>())) {
+            return {true, 0};
+        }
+        const auto& component = GetComponentPool<TComponent>().GetObject(m_componentIndexCards[index][GetComponentIndex<TComponent>()]);
+        return {false, EncodeSortKey<TKey>(key(component), std::is_floating_point<TKey>{})};
+    };
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::ClearSortKey () {
+    m_sortKey = nullptr;
+    m_sortKeys.clear();
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::SortEntities () {
+    if (!m_sortKey) {
+        return;
+    }
+    m_sortKeys.resize(m_entityActiveCount);
+    for (uint32_t i = 0; i < m_entityActiveCount; ++i) {
+        m_sortKeys[i] = m_sortKey(i);
+    }
+    // Order changes little between frames, so fix it up in place with swaps. If that turns
+    // out to need too many swaps, fall back to a full permutation.
+    if (!InsertionSortEntities(m_entityActiveCount)) {
+        PermuteSortEntities();
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TPosition, typename TPointFunc>
+void EntityManager<TComponentList, TResourceList>::EnableSpatialIndex (float cellSize, TPointFunc&& toPoint) {
+    static_assert(TComponentList::Contains<TPosition>(),
+        "Cannot index component of a type that has not been registered in the ECS::EntityManager");
+    m_spatialGrid = std::make_unique<SpatialGrid>(cellSize);
+    m_spatialComponentIndex = GetComponentIndex<TPosition>();
+    m_spatialPoint = [this, toPoint = std::forward<TPointFunc>(toPoint)](uint32_t index) -> SpatialPoint {
+        return toPoint(GetComponentPool<TPosition>().GetObject(m_componentIndexCards[index][GetComponentIndex<TPosition>()]));
+    };
+    RebuildSpatialIndex();
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::DisableSpatialIndex () {
+    m_spatialGrid.reset();
+    m_spatialPoint = nullptr;
+    ClearSpatialMoved();
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::UpdateSpatialIndex (const Entity& id) {
+    ECS_ASSERT_(m_spatialGrid);
+    ECS_ASSERT_(IsValid(id));
+    auto index = m_entityMap[id];
+    if (m_componentMasks[index].test(m_spatialComponentIndex)) {
+        m_spatialGrid->Move(id, m_spatialPoint(index));
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::MarkMoved (const Entity& id) {
+    ECS_ASSERT_(m_spatialGrid);
+    ECS_ASSERT_(IsValid(id));
+    MarkIndexMoved(m_entityMap[id]);
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::RefreshSpatialIndex () {
+    ECS_ASSERT_(m_spatialGrid);
+    for (const auto& id : m_spatialMoved) {
+        // Marked entities may have been destroyed or lost the component since.
+        auto entityIter = m_entityMap.find(id);
+        if (entityIter == m_entityMap.cend()) {
+            continue;
+        }
+        auto& mask = m_componentMasks[entityIter->second];
+        mask.reset(c_spatialMovedBit);
+        if (mask.test(m_spatialComponentIndex)) {
+            m_spatialGrid->Move(id, m_spatialPoint(entityIter->second));
+        }
+    }
+    m_spatialMoved.clear();
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::RebuildSpatialIndex (uint32_t threadCount) {
+    ECS_ASSERT_(m_spatialGrid);
+    std::vector<uint32_t> indices{};
+    for (uint32_t i = 0; i < m_entities.size(); ++i) {
+        if (m_componentMasks[i].test(m_spatialComponentIndex)) {
+            indices.push_back(i);
+        }
+    }
+    std::vector<SpatialGrid::Entry> entries(indices.size());
+    ParallelFor(static_cast<uint32_t>(indices.size()), threadCount, [this, &indices, &entries](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            entries[i] = {m_entities[indices[i]], m_spatialPoint(indices[i])};
+        }
     });
+    m_spatialGrid->Rebuild(entries, threadCount);
+    ClearSpatialMoved();
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::QueryRadius (const SpatialPoint& center, float radius, std::vector<Entity>& result) const {
+    ECS_ASSERT_(m_spatialGrid);
+    m_spatialGrid->QueryRadius(center, radius, result);
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::QueryBounds (const SpatialBounds& bounds, std::vector<Entity>& result) const {
+    ECS_ASSERT_(m_spatialGrid);
+    m_spatialGrid->QueryBounds(bounds, result);
+}
 
+template <typename TComponentList, typename TResourceList>
+template <typename TFunc>
+void EntityManager<TComponentList, TResourceList>::ForEachInRadius (const SpatialPoint& center, float radius, TFunc&& callback) {
+    std::vector<Entity> ids{};
+    QueryRadius(center, radius, ids);
+    ForEachOf(ids, std::forward<TFunc>(callback));
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TFunc>
+void EntityManager<TComponentList, TResourceList>::ForEachInBounds (const SpatialBounds& bounds, TFunc&& callback) {
+    std::vector<Entity> ids{};
+    QueryBounds(bounds, ids);
+    ForEachOf(ids, std::forward<TFunc>(callback));
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TFunc>
+void EntityManager<TComponentList, TResourceList>::ForEach (TFunc&& callback) {
+    using FCallback = CallbackArgs<decltype(callback)>;
+    const ComponentMask targetMask = MakeTargetMask<typename FCallback::ComponentArgs>();
+    const bool marksMoved = WritesSpatialComponent<typename FCallback::ComponentArgs>();
+    auto resourceArgs = MakeResourceArgs(typename FCallback::ResourceArgs{});
     for (uint32_t i = 0; i < m_entityActiveCount; ++i) {
         if ((targetMask & m_componentMasks[i]) == targetMask) {
+            if (marksMoved) {
+                MarkIndexMoved(i);
+            }
             UnpackAndCallback(
                 i,
                 callback,
-                FComponentArgs{},
-                typename GenerateSequence<FTraits::ArgCount>::Type{}
+                resourceArgs,
+                typename FCallback::Args{},
+                typename FCallback::Seq{}
             );
         }
     }
 }
 
-template <typename TComponentList>
+template <typename TComponentList, typename TResourceList>
 template <typename TObject, typename TFunc>
-void EntityManager<TComponentList>::ForEach (TObject* self, TFunc&& callback) {
-    using FTraits = FunctionTraits<decltype(callback)>;
-    static_assert(FTraits::ArgCount > 0, "First callback param must be ECS::Entity.");
-    static_assert(std::is_same<FTraits::Arg<0>, Entity>::value, "First callback param must be ECS::Entity.");
-    using FComponentArgs = typename FTraits::Args::RemoveFirst;
-
-    ComponentMask targetMask{};
-    FComponentArgs::ForTypes([&targetMask] (auto t) {
-        (void)t;
-        static_assert(TComponentList::Contains<std::decay_t<TYPE_OF(t)>>(),
-            "Cannot get component of a type that has not been registered in the ECS::EntityManager");
-        targetMask.set(GetComponentIndex<TYPE_OF(t)>());
-    });
-
+void EntityManager<TComponentList, TResourceList>::ForEach (TObject* self, TFunc&& callback) {
+    using FCallback = CallbackArgs<decltype(callback)>;
+    const ComponentMask targetMask = MakeTargetMask<typename FCallback::ComponentArgs>();
+    const bool marksMoved = WritesSpatialComponent<typename FCallback::ComponentArgs>();
+    auto resourceArgs = MakeResourceArgs(typename FCallback::ResourceArgs{});
     for (uint32_t i = 0; i < m_entityActiveCount; ++i) {
         if ((targetMask & m_componentMasks[i]) == targetMask) {
+            if (marksMoved) {
+                MarkIndexMoved(i);
+            }
             UnpackAndCallbackMember(
                 self,
                 i,
                 callback,
-                FComponentArgs{},
-                typename GenerateSequence<FTraits::ArgCount>::Type{}
+                resourceArgs,
+                typename FCallback::Args{},
+                typename FCallback::Seq{}
             );
         }
     }
 }
 
-template <typename TComponentList>
+template <typename TComponentList, typename TResourceList>
 template <typename TSystem, typename... TArgs>
-void EntityManager<TComponentList>::RegisterSystem (TArgs&&... args) {
-    static_assert(std::is_base_of<System, TSystem>::value, "TSystem must be derived from System<EntityManager<TComponentList>>.");
+void EntityManager<TComponentList, TResourceList>::RegisterSystem (TArgs&&... args) {
+    static_assert(std::is_base_of<System, TSystem>::value, "TSystem must be derived from System<EntityManager<TComponentList, TResourceList>>.");
     m_systems.push_back([this, system = TSystem(std::forward<TArgs>(args)...)](float deltaTime) mutable {
         system.m_entityManager = this;
         system.m_deltaTime = deltaTime;
@@ -310,65 +736,334 @@ void EntityManager<TComponentList>::RegisterSystem (TArgs&&... args) {
     });
 }
 
-template <typename TComponentList>
-void EntityManager<TComponentList>::RunSystems (float deltaTime) {
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::RunSystems (float deltaTime) {
+    FlushEvents();
+    SortEntities();
     for (const auto& system : m_systems) {
+        // Apply moves recorded so far, so each system queries up-to-date positions.
+        if (m_spatialGrid) {
+            RefreshSpatialIndex();
+        }
         system(deltaTime);
     }
+    if (m_spatialGrid) {
+        RefreshSpatialIndex();
+    }
 }
 
-template <typename TComponentList>
+template <typename TComponentList, typename TResourceList>
 template <typename TComponent>
-static constexpr std::size_t EntityManager<TComponentList>::GetComponentIndex () {
+static constexpr std::size_t EntityManager<TComponentList, TResourceList>::GetComponentIndex () {
     return TComponentList::IndexOf<std::decay_t<TComponent>>();
 }
 
-template <typename TComponentList>
+template <typename TComponentList, typename TResourceList>
+typename EntityManager<TComponentList, TResourceList>::ComponentMask EntityManager<TComponentList, TResourceList>::NewEntityMask () {
+    ComponentMask mask{};
+    mask.set(c_enabledBit);
+    return mask;
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TComponentArgs>
+typename EntityManager<TComponentList, TResourceList>::ComponentMask EntityManager<TComponentList, TResourceList>::MakeTargetMask () {
+    ComponentMask targetMask{};
+    targetMask.set(c_enabledBit);
+    TComponentArgs::ForTypes([&targetMask] (auto t) {
+        (void)t;
+        static_assert(TComponentList::Contains<std::decay_t<TYPE_OF(t)>>(),
+            "Cannot get component of a type that has not been registered in the ECS::EntityManager");
+        targetMask.set(GetComponentIndex<TYPE_OF(t)>());
+    });
+    return targetMask;
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TComponentArgs>
+bool EntityManager<TComponentList, TResourceList>::WritesSpatialComponent () const {
+    if (!m_spatialGrid) {
+        return false;
+    }
+    ComponentMask writeMask{};
+    TComponentArgs::ForTypes([&writeMask] (auto t) {
+        (void)t;
+        using TArg = TYPE_OF(t);
+        if (std::is_lvalue_reference<TArg>::value && !std::is_const<std::remove_reference_t<TArg>>::value) {
+            writeMask.set(GetComponentIndex<TArg>());
+        }
+    });
+    return writeMask.test(m_spatialComponentIndex);
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TKey>
+uint64_t EntityManager<TComponentList, TResourceList>::EncodeSortKey (TKey key, std::false_type) {
+    // Flip the sign bit of signed values so negative keys order before positive ones.
+    const uint64_t signBit = std::is_signed<TKey>::value ? (1ull << 63) : 0;
+    return static_cast<uint64_t>(key) ^ signBit;
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TKey>
+uint64_t EntityManager<TComponentList, TResourceList>::EncodeSortKey (TKey key, std::true_type) {
+    // IEEE doubles order like their bits once negative values have all bits flipped
+    // and positive values have the sign bit set.
+    const double value = static_cast<double>(key);
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits & (1ull << 63)) ? ~bits : (bits | (1ull << 63));
+}
+
+template <typename TComponentList, typename TResourceList>
 template <typename TComponent>
-BlockObjectPool<std::decay_t<TComponent>>& EntityManager<TComponentList>::GetComponentPool () {
+BlockObjectPool<std::decay_t<TComponent>>& EntityManager<TComponentList, TResourceList>::GetComponentPool () {
     return std::get<TComponentList::IndexOf<std::decay_t<TComponent>>()>(m_componentPools);
 }
 
-template <typename TComponentList>
-template <typename TFunc, typename... Args, std::size_t... Seq>
-void EntityManager<TComponentList>::UnpackAndCallback (uint32_t entityIndex, TFunc&& callback, TypeList<Args...>, Sequence<Seq...>) {
+template <typename TComponentList, typename TResourceList>
+template <typename... Args>
+std::tuple<std::decay_t<Args>...> EntityManager<TComponentList, TResourceList>::MakeResourceArgs (TypeList<Args...>) {
+    return std::make_tuple(MakeResourceArg(static_cast<std::decay_t<Args>*>(nullptr))...);
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TArg>
+Res<TArg> EntityManager<TComponentList, TResourceList>::MakeResourceArg (Res<TArg>*) {
+    return Res<TArg>{GetResource<TArg>()};
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TArg>
+ResMut<TArg> EntityManager<TComponentList, TResourceList>::MakeResourceArg (ResMut<TArg>*) {
+    return ResMut<TArg>{GetResource<TArg>()};
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TArgs, std::size_t Position, typename TResourceArgs>
+auto EntityManager<TComponentList, TResourceList>::GetCallbackArg (const ComponentIndexCard& indexCard, TResourceArgs& resourceArgs, std::false_type) {
+    using TArg = typename TArgs::template Get<Position>;
+    (void)resourceArgs;
+    return std::ref(GetComponentPool<TArg>().GetObject(indexCard[GetComponentIndex<TArg>()]));
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TArgs, std::size_t Position, typename TResourceArgs>
+auto EntityManager<TComponentList, TResourceList>::GetCallbackArg (const ComponentIndexCard& indexCard, TResourceArgs& resourceArgs, std::true_type) {
+    (void)indexCard;
+    // Resource handles are stored in param order, so the same handle type may appear more than once.
+    return std::get<CountResourceArgs<Position, TArgs>::value>(resourceArgs);
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TFunc, typename TResourceArgs, typename... Args, std::size_t... Seq>
+void EntityManager<TComponentList, TResourceList>::UnpackAndCallback (uint32_t entityIndex, TFunc&& callback, TResourceArgs& resourceArgs, TypeList<Args...>, Sequence<Seq...>) {
     auto& indexCard = m_componentIndexCards[entityIndex];
-    auto params = std::make_tuple(
+    callback(
         m_entities[entityIndex],
-        std::ref(GetComponentPool<Args>().GetObject(indexCard[GetComponentIndex<Args>()]))...
+        GetCallbackArg<TypeList<Args...>, Seq>(indexCard, resourceArgs, IsResourceArg<Args>{})...
     );
-    callback(std::get<Seq>(params)...);
 }
 
-template <typename TComponentList>
-template <typename TObject, typename TFunc, typename... Args, std::size_t... Seq>
-void EntityManager<TComponentList>::UnpackAndCallbackMember (TObject* self, uint32_t entityIndex, TFunc&& callback, TypeList<Args...>, Sequence<Seq...>) {
+template <typename TComponentList, typename TResourceList>
+template <typename TObject, typename TFunc, typename TResourceArgs, typename... Args, std::size_t... Seq>
+void EntityManager<TComponentList, TResourceList>::UnpackAndCallbackMember (TObject* self, uint32_t entityIndex, TFunc&& callback, TResourceArgs& resourceArgs, TypeList<Args...>, Sequence<Seq...>) {
     auto& indexCard = m_componentIndexCards[entityIndex];
-    auto params = std::make_tuple(
+    (self->*callback)(
         m_entities[entityIndex],
-        std::ref(GetComponentPool<Args>().GetObject(indexCard[GetComponentIndex<Args>()]))...
+        GetCallbackArg<TypeList<Args...>, Seq>(indexCard, resourceArgs, IsResourceArg<Args>{})...
     );
-    (self->*callback)(std::get<Seq>(params)...);
 }
 
-template <typename TComponentList>
-bool EntityManager<TComponentList>::IndexIsActive (uint32_t index) const {
+template <typename TComponentList, typename TResourceList>
+uint32_t EntityManager<TComponentList, TResourceList>::InsertEntityRows (uint32_t count, bool active) {
+    const uint32_t oldSize = static_cast<uint32_t>(m_entities.size());
+    m_entityMap.reserve(oldSize + count);
+    m_componentMasks.resize(oldSize + count);
+    m_componentIndexCards.resize(oldSize + count);
+    m_entities.resize(oldSize + count);
+    if (!active) {
+        return oldSize;
+    }
+
+    // Move as many inactive rows as needed to the end to open a gap after the active rows.
+    const uint32_t firstIndex = m_entityActiveCount;
+    const uint32_t movedCount = std::min(count, oldSize - m_entityActiveCount);
+    for (uint32_t i = 0; i < movedCount; ++i) {
+        const uint32_t src = firstIndex + i;
+        const uint32_t dst = oldSize + count - movedCount + i;
+        m_entityMap[m_entities[src]] = dst;
+        m_componentMasks[dst] = m_componentMasks[src];
+        m_componentIndexCards[dst] = m_componentIndexCards[src];
+        m_entities[dst] = m_entities[src];
+    }
+    m_entityActiveCount += count;
+    return firstIndex;
+}
+
+template <typename TComponentList, typename TResourceList>
+bool EntityManager<TComponentList, TResourceList>::InsertionSortEntities (uint32_t maxSwaps) {
+    uint32_t swaps = 0;
+    for (uint32_t i = 1; i < m_entityActiveCount; ++i) {
+        for (uint32_t j = i; j > 0 && m_sortKeys[j - 1] > m_sortKeys[j]; --j) {
+            if (swaps == maxSwaps) {
+                return false;
+            }
+            SwapEntities(j - 1, j);
+            std::swap(m_sortKeys[j - 1], m_sortKeys[j]);
+            ++swaps;
+        }
+    }
+    return true;
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::PermuteSortEntities () {
+    std::vector<uint32_t> order(m_entityActiveCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](uint32_t lhs, uint32_t rhs) {
+        return m_sortKeys[lhs] < m_sortKeys[rhs];
+    });
+
+    std::vector<ComponentMask> masks(m_entityActiveCount);
+    std::vector<ComponentIndexCard> indexCards(m_entityActiveCount);
+    std::vector<Entity> entities(m_entityActiveCount);
+    for (uint32_t i = 0; i < m_entityActiveCount; ++i) {
+        masks[i] = m_componentMasks[order[i]];
+        indexCards[i] = m_componentIndexCards[order[i]];
+        entities[i] = m_entities[order[i]];
+    }
+    for (uint32_t i = 0; i < m_entityActiveCount; ++i) {
+        m_entityMap[entities[i]] = i;
+        m_componentMasks[i] = masks[i];
+        m_componentIndexCards[i] = indexCards[i];
+        m_entities[i] = entities[i];
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::SpatialIndexInsert (uint32_t index, std::size_t componentIndex) {
+    if (m_spatialGrid && componentIndex == m_spatialComponentIndex && m_componentMasks[index].test(componentIndex)) {
+        m_spatialGrid->Insert(m_entities[index], m_spatialPoint(index));
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::SpatialIndexRemove (uint32_t index, std::size_t componentIndex) {
+    if (m_spatialGrid && componentIndex == m_spatialComponentIndex && m_componentMasks[index].test(componentIndex)) {
+        m_spatialGrid->Remove(m_entities[index]);
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::MarkIndexMoved (uint32_t index) {
+    if (!m_componentMasks[index].test(c_spatialMovedBit)) {
+        m_componentMasks[index].set(c_spatialMovedBit);
+        m_spatialMoved.push_back(m_entities[index]);
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::ClearSpatialMoved () {
+    for (const auto& id : m_spatialMoved) {
+        auto entityIter = m_entityMap.find(id);
+        if (entityIter != m_entityMap.cend()) {
+            m_componentMasks[entityIter->second].reset(c_spatialMovedBit);
+        }
+    }
+    m_spatialMoved.clear();
+}
+
+template <typename TComponentList, typename TResourceList>
+template <typename TFunc>
+void EntityManager<TComponentList, TResourceList>::ForEachOf (const std::vector<Entity>& ids, TFunc&& callback) {
+    using FCallback = CallbackArgs<decltype(callback)>;
+    const ComponentMask targetMask = MakeTargetMask<typename FCallback::ComponentArgs>();
+    const bool marksMoved = WritesSpatialComponent<typename FCallback::ComponentArgs>();
+    auto resourceArgs = MakeResourceArgs(typename FCallback::ResourceArgs{});
+    for (const auto& id : ids) {
+        auto entityIter = m_entityMap.find(id);
+        if (entityIter == m_entityMap.cend() || !IndexIsActive(entityIter->second)) {
+            continue;
+        }
+        const uint32_t i = entityIter->second;
+        if ((targetMask & m_componentMasks[i]) == targetMask) {
+            if (marksMoved) {
+                MarkIndexMoved(i);
+            }
+            UnpackAndCallback(
+                i,
+                callback,
+                resourceArgs,
+                typename FCallback::Args{},
+                typename FCallback::Seq{}
+            );
+        }
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::QueueEvent (ComponentEvents& events, const ComponentObservers& observers, std::size_t componentIndex, const Entity& id) {
+    // While dispatching, newly registered observers are still pending, so queue unconditionally.
+    if (m_dispatching || !observers[componentIndex].empty()) {
+        events[componentIndex].push_back(id);
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::AddObserver (ComponentObservers& observers, ComponentObservers& pendingObservers, std::size_t componentIndex, ObserverCallback observer) {
+    if (m_dispatching) {
+        pendingObservers[componentIndex].push_back(std::move(observer));
+    }
+    else {
+        observers[componentIndex].push_back(std::move(observer));
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::AppendPendingObservers (ComponentObservers& observers, ComponentObservers& pendingObservers) {
+    for (std::size_t i = 0; i < TComponentList::Size; ++i) {
+        for (auto& observer : pendingObservers[i]) {
+            observers[i].push_back(std::move(observer));
+        }
+        pendingObservers[i].clear();
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::DispatchEvents (ComponentEvents& events, const ComponentObservers& observers) {
+    std::swap(events, m_dispatchBatches);
+    for (std::size_t i = 0; i < TComponentList::Size; ++i) {
+        auto& batch = m_dispatchBatches[i];
+        if (batch.empty()) {
+            continue;
+        }
+        for (std::size_t j = 0; j < observers[i].size(); ++j) {
+            observers[i][j](batch);
+        }
+        batch.clear();
+    }
+}
+
+template <typename TComponentList, typename TResourceList>
+bool EntityManager<TComponentList, TResourceList>::IndexIsActive (uint32_t index) const {
     return index < m_entityActiveCount;
 }
 
-template <typename TComponentList>
-void EntityManager<TComponentList>::IndexSetActive (uint32_t& index, bool active) {
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::IndexSetActive (uint32_t& index, bool active) {
     if (active == IndexIsActive(index)) {
         return;
     }
-    const uint32_t newIndex = (m_entityActiveCount < m_entities.size()) ? m_entityActiveCount : (m_entities.size() - 1);
+    // Swap with the first inactive entity to activate, or with the last active entity to deactivate.
+    const uint32_t newIndex = active ? m_entityActiveCount : (m_entityActiveCount - 1);
     SwapEntities(index, newIndex);
     m_entityActiveCount += (active ? 1 : -1);
     index = newIndex;
 }
 
-template <typename TComponentList>
-void EntityManager<TComponentList>::SwapEntities (uint32_t lhsIndex, uint32_t rhsIndex) {
+template <typename TComponentList, typename TResourceList>
+void EntityManager<TComponentList, TResourceList>::SwapEntities (uint32_t lhsIndex, uint32_t rhsIndex) {
     if (lhsIndex == rhsIndex) {
         return;
     }
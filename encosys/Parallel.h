@@ -0,0 +1,27 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "EcsTypes.h"
+
+namespace ECS {
+
+// Splits [0, count) into threadCount contiguous batches and runs func(begin, end) on each batch
+// in parallel. The calling thread runs the first batch, so threadCount <= 1 spawns no threads.
+template <typename TFunc>
+void ParallelFor (uint32_t count, uint32_t threadCount, TFunc&& func) {
+    threadCount = std::max(1u, std::min(threadCount, count));
+    const uint32_t batchSize = (count + threadCount - 1) / threadCount;
+    std::vector<std::thread> threads{};
+    for (uint32_t begin = batchSize; begin < count; begin += batchSize) {
+        const uint32_t end = std::min(begin + batchSize, count);
+        threads.emplace_back([&func, begin, end]() { func(begin, end); });
+    }
+    func(0, std::min(batchSize, count));
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <tuple>
+#include <utility>
+#include "EcsTypes.h"
+#include "TypeList.h"
+
+namespace ECS {
+
+// Prefab is a reusable bundle of component values that can be instantiated many times at once.
+template <typename... TComponents>
+class Prefab {
+public:
+    using ComponentList = TypeList<TComponents...>;
+
+    Prefab () = default;
+    explicit Prefab (TComponents... components) : m_components{std::move(components)...} {}
+
+    template <typename TComponent>
+    TComponent& Get () { return std::get<TComponent>(m_components); }
+
+    template <typename TComponent>
+    const TComponent& Get () const { return std::get<TComponent>(m_components); }
+
+private:
+    std::tuple<TComponents...> m_components{};
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <type_traits>
+#include "EcsTypes.h"
+#include "TypeList.h"
+
+namespace ECS {
+
+// Read-only handle to a world-level resource, usable as a system Update parameter.
+template <typename T>
+class Res {
+public:
+    using Type = T;
+
+    explicit Res (const T& resource) : m_resource{&resource} {}
+
+    const T& Get () const { return *m_resource; }
+    const T& operator* () const { return *m_resource; }
+    const T* operator-> () const { return m_resource; }
+
+private:
+    const T* m_resource{};
+};
+
+// Mutable handle to a world-level resource, usable as a system Update parameter.
+template <typename T>
+class ResMut {
+public:
+    using Type = T;
+
+    explicit ResMut (T& resource) : m_resource{&resource} {}
+
+    T& Get () const { return *m_resource; }
+    T& operator* () const { return *m_resource; }
+    T* operator-> () const { return m_resource; }
+
+private:
+    T* m_resource{};
+};
+
+// Check if a callback param is a resource handle rather than a component
+template <typename T>
+struct _IsResourceArg : std::false_type {};
+
+template <typename T>
+struct _IsResourceArg<Res<T>> : std::true_type {};
+
+template <typename T>
+struct _IsResourceArg<ResMut<T>> : std::true_type {};
+
+template <typename T>
+using IsResourceArg = _IsResourceArg<std::decay_t<T>>;
+
+template <typename T>
+using IsComponentArg = std::integral_constant<bool, !IsResourceArg<T>::value>;
+
+// Count the resource handles among the first N params of a type list
+template <std::size_t N, typename TList>
+struct CountResourceArgs : std::integral_constant<std::size_t, 0> {};
+
+template <std::size_t N, typename T, typename... Ts>
+struct CountResourceArgs<N, TypeList<T, Ts...>> : std::integral_constant<std::size_t,
+    (N == 0) ? 0 : (IsResourceArg<T>::value ? 1 : 0) + CountResourceArgs<(N == 0) ? 0 : N - 1, TypeList<Ts...>>::value> {};
+
+}
\ No newline at end of file
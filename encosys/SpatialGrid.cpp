@@ -0,0 +1,212 @@
+#include "SpatialGrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include "EcsTypes.h"
+#include "Parallel.h"
+
+namespace ECS {
+
+SpatialGrid::SpatialGrid (float cellSize)
+    : m_cellSize{cellSize} {
+    ECS_ASSERT_(cellSize > 0.0f);
+}
+
+uint32_t SpatialGrid::GetSize () const {
+    std::size_t size = 0;
+    for (const auto& shard : m_shards) {
+        size += shard.entityCells.size();
+    }
+    return static_cast<uint32_t>(size);
+}
+
+uint32_t SpatialGrid::GetCellCount () const {
+    std::size_t count = 0;
+    for (const auto& shard : m_shards) {
+        count += shard.cells.size();
+    }
+    return static_cast<uint32_t>(count);
+}
+
+void SpatialGrid::Insert (const Entity& id, const SpatialPoint& point) {
+    auto& entityCells = GetEntityCells(id);
+    ECS_ASSERT_(entityCells.find(id) == entityCells.cend());
+    const CellKey key = GetCellKey(point);
+    entityCells[id] = key;
+    GetCells(key)[key].push_back({id, point});
+}
+
+void SpatialGrid::Move (const Entity& id, const SpatialPoint& point) {
+    auto& entityCells = GetEntityCells(id);
+    auto entityIter = entityCells.find(id);
+    ECS_ASSERT_(entityIter != entityCells.cend());
+    const CellKey key = GetCellKey(point);
+    auto& oldCells = GetCells(entityIter->second);
+    auto cellIter = oldCells.find(entityIter->second);
+    ECS_ASSERT_(cellIter != oldCells.end());
+    auto& cell = cellIter->second;
+    auto entryIter = std::find_if(cell.begin(), cell.end(), [&id](const Entry& entry) { return entry.first == id; });
+    ECS_ASSERT_(entryIter != cell.end());
+    if (key == entityIter->second) {
+        entryIter->second = point;
+        return;
+    }
+    *entryIter = cell.back();
+    cell.pop_back();
+    if (cell.empty()) {
+        oldCells.erase(cellIter);
+    }
+    entityIter->second = key;
+    GetCells(key)[key].push_back({id, point});
+}
+
+void SpatialGrid::Remove (const Entity& id) {
+    auto& entityCells = GetEntityCells(id);
+    auto entityIter = entityCells.find(id);
+    ECS_ASSERT_(entityIter != entityCells.cend());
+    auto& cells = GetCells(entityIter->second);
+    auto cellIter = cells.find(entityIter->second);
+    ECS_ASSERT_(cellIter != cells.end());
+    auto& cell = cellIter->second;
+    auto entryIter = std::find_if(cell.begin(), cell.end(), [&id](const Entry& entry) { return entry.first == id; });
+    ECS_ASSERT_(entryIter != cell.end());
+    *entryIter = cell.back();
+    cell.pop_back();
+    if (cell.empty()) {
+        cells.erase(cellIter);
+    }
+    entityCells.erase(entityIter);
+}
+
+void SpatialGrid::Clear () {
+    for (auto& shard : m_shards) {
+        shard.cells.clear();
+        shard.entityCells.clear();
+    }
+}
+
+void SpatialGrid::Rebuild (const std::vector<Entry>& entries, uint32_t threadCount) {
+    const uint32_t count = static_cast<uint32_t>(entries.size());
+    std::vector<CellKey> keys(count);
+    std::vector<uint8_t> cellShards(count);
+    std::vector<uint8_t> entityShards(count);
+    ParallelFor(count, threadCount, [this, &entries, &keys, &cellShards, &entityShards](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            keys[i] = GetCellKey(entries[i].second);
+            cellShards[i] = static_cast<uint8_t>(GetShard(keys[i]));
+            entityShards[i] = static_cast<uint8_t>(GetShard(entries[i].first.Id()));
+        }
+    });
+
+    // Counting sort entry indices by shard so each shard only visits its own entries.
+    auto sortByShard = [count](const std::vector<uint8_t>& shards, std::vector<uint32_t>& order, std::array<uint32_t, c_shardCount + 1>& offsets) {
+        offsets.fill(0);
+        for (uint32_t i = 0; i < count; ++i) {
+            ++offsets[shards[i] + 1];
+        }
+        for (uint32_t s = 0; s < c_shardCount; ++s) {
+            offsets[s + 1] += offsets[s];
+        }
+        std::array<uint32_t, c_shardCount + 1> cursors = offsets;
+        order.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            order[cursors[shards[i]]++] = i;
+        }
+    };
+    std::vector<uint32_t> cellOrder{};
+    std::vector<uint32_t> entityOrder{};
+    std::array<uint32_t, c_shardCount + 1> cellOffsets{};
+    std::array<uint32_t, c_shardCount + 1> entityOffsets{};
+    sortByShard(cellShards, cellOrder, cellOffsets);
+    sortByShard(entityShards, entityOrder, entityOffsets);
+
+    // Shards share nothing, so they are filled in parallel.
+    ParallelFor(c_shardCount, threadCount, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t s = begin; s < end; ++s) {
+            auto& shard = m_shards[s];
+            // Keep cell storage around for reuse, dropping only cells that end up empty.
+            for (auto& cell : shard.cells) {
+                cell.second.clear();
+            }
+            for (uint32_t j = cellOffsets[s]; j < cellOffsets[s + 1]; ++j) {
+                shard.cells[keys[cellOrder[j]]].push_back(entries[cellOrder[j]]);
+            }
+            for (auto cellIter = shard.cells.begin(); cellIter != shard.cells.end();) {
+                cellIter = cellIter->second.empty() ? shard.cells.erase(cellIter) : std::next(cellIter);
+            }
+
+            shard.entityCells.clear();
+            shard.entityCells.reserve(entityOffsets[s + 1] - entityOffsets[s]);
+            for (uint32_t j = entityOffsets[s]; j < entityOffsets[s + 1]; ++j) {
+                shard.entityCells[entries[entityOrder[j]].first] = keys[entityOrder[j]];
+            }
+        }
+    });
+}
+
+void SpatialGrid::QueryRadius (const SpatialPoint& center, float radius, std::vector<Entity>& result) const {
+    const SpatialBounds bounds{
+        {center.x - radius, center.y - radius, center.z - radius},
+        {center.x + radius, center.y + radius, center.z + radius}
+    };
+    const float radiusSq = radius * radius;
+    ForCellsInBounds(bounds, [&center, radiusSq, &result](const std::vector<Entry>& cell) {
+        for (const auto& entry : cell) {
+            const float dx = entry.second.x - center.x;
+            const float dy = entry.second.y - center.y;
+            const float dz = entry.second.z - center.z;
+            if (dx * dx + dy * dy + dz * dz <= radiusSq) {
+                result.push_back(entry.first);
+            }
+        }
+    });
+}
+
+void SpatialGrid::QueryBounds (const SpatialBounds& bounds, std::vector<Entity>& result) const {
+    ForCellsInBounds(bounds, [&bounds, &result](const std::vector<Entry>& cell) {
+        for (const auto& entry : cell) {
+            const auto& point = entry.second;
+            if (point.x >= bounds.min.x && point.x <= bounds.max.x &&
+                point.y >= bounds.min.y && point.y <= bounds.max.y &&
+                point.z >= bounds.min.z && point.z <= bounds.max.z) {
+                result.push_back(entry.first);
+            }
+        }
+    });
+}
+
+uint32_t SpatialGrid::GetShard (uint64_t value) {
+    // Fibonacci hashing, so that keys differing only in high coordinate bits still spread out.
+    return static_cast<uint32_t>((value * 0x9E3779B97F4A7C15ull) >> (64 - c_shardBits));
+}
+
+SpatialGrid::CellKey SpatialGrid::GetCellKey (int32_t x, int32_t y, int32_t z) {
+    const uint64_t mask = (1ull << c_cellCoordBits) - 1;
+    return ((static_cast<uint64_t>(x) & mask) << (2 * c_cellCoordBits)) |
+        ((static_cast<uint64_t>(y) & mask) << c_cellCoordBits) |
+        (static_cast<uint64_t>(z) & mask);
+}
+
+int32_t SpatialGrid::GetKeyCoord (CellKey key, uint32_t shift) {
+    // Sign extend the 21 bit coordinate stored at shift.
+    const int32_t coord = static_cast<int32_t>((key >> shift) & ((1ull << c_cellCoordBits) - 1));
+    return (coord > c_maxCellCoord) ? coord - (1 << c_cellCoordBits) : coord;
+}
+
+SpatialGrid::CellKey SpatialGrid::GetCellKey (const SpatialPoint& point) const {
+    return GetCellKey(GetCellCoord(point.x), GetCellCoord(point.y), GetCellCoord(point.z));
+}
+
+int32_t SpatialGrid::GetCellCoord (float value) const {
+    // Clamp before converting so huge (or NaN) values cannot overflow the integer conversion.
+    const double cell = std::floor(static_cast<double>(value) / m_cellSize);
+    if (!(cell >= c_minCellCoord)) {
+        return c_minCellCoord;
+    }
+    if (cell > c_maxCellCoord) {
+        return c_maxCellCoord;
+    }
+    return static_cast<int32_t>(cell);
+}
+
+}
\ No newline at end of file
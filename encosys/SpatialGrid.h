@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Entity.h"
+
+namespace ECS {
+
+struct SpatialPoint {
+    float x{};
+    float y{};
+    float z{};
+};
+
+struct SpatialBounds {
+    SpatialPoint min{};
+    SpatialPoint max{};
+};
+
+// Uniform grid that buckets entities by the cell their point falls into.
+// Cells and entities are split into shards by hash so that Rebuild can fill shards in parallel.
+class SpatialGrid {
+public:
+    using Entry = std::pair<Entity, SpatialPoint>;
+
+    explicit SpatialGrid (float cellSize);
+
+    float GetCellSize () const { return m_cellSize; }
+    uint32_t GetSize () const;
+    uint32_t GetCellCount () const;
+
+    void Insert (const Entity& id, const SpatialPoint& point);
+    void Move (const Entity& id, const SpatialPoint& point);
+    void Remove (const Entity& id);
+    void Clear ();
+
+    // Replaces the contents of the grid, using threadCount threads.
+    void Rebuild (const std::vector<Entry>& entries, uint32_t threadCount = 1);
+
+    // Appends matching entities to result.
+    void QueryRadius (const SpatialPoint& center, float radius, std::vector<Entity>& result) const;
+    void QueryBounds (const SpatialBounds& bounds, std::vector<Entity>& result) const;
+
+private:
+    using CellKey = uint64_t;
+    using Cells = std::unordered_map<CellKey, std::vector<Entry>>;
+
+    struct Shard {
+        // cells maps each cell key in this shard to the entities (and their points) inside that cell.
+        Cells cells{};
+
+        // entityCells maps each entity in this shard to the key of the cell it is stored in.
+        std::unordered_map<Entity, CellKey> entityCells{};
+    };
+
+    static constexpr uint32_t c_shardBits = 4;
+    static constexpr uint32_t c_shardCount = 1u << c_shardBits;
+
+    // Cell coordinates are clamped to 21 bits each so they pack into a unique 64 bit key.
+    static constexpr int32_t c_cellCoordBits = 21;
+    static constexpr int32_t c_minCellCoord = -(1 << (c_cellCoordBits - 1));
+    static constexpr int32_t c_maxCellCoord = (1 << (c_cellCoordBits - 1)) - 1;
+
+    static uint32_t GetShard (uint64_t value);
+    static CellKey GetCellKey (int32_t x, int32_t y, int32_t z);
+    static int32_t GetKeyCoord (CellKey key, uint32_t shift);
+    CellKey GetCellKey (const SpatialPoint& point) const;
+    int32_t GetCellCoord (float value) const;
+
+    Cells& GetCells (CellKey key) { return m_shards[GetShard(key)].cells; }
+    std::unordered_map<Entity, CellKey>& GetEntityCells (const Entity& id) { return m_shards[GetShard(id.Id())].entityCells; }
+
+    template <typename TFunc>
+    void ForCellsInBounds (const SpatialBounds& bounds, TFunc&& func) const;
+
+    // m_cellSize is the width of each cubic cell.
+    float m_cellSize{1.0f};
+
+    // m_shards contains the cells and entities, each placed in the shard picked by its hash.
+    std::array<Shard, c_shardCount> m_shards{};
+};
+
+template <typename TFunc>
+void SpatialGrid::ForCellsInBounds (const SpatialBounds& bounds, TFunc&& func) const {
+    const int32_t minX = GetCellCoord(bounds.min.x), maxX = GetCellCoord(bounds.max.x);
+    const int32_t minY = GetCellCoord(bounds.min.y), maxY = GetCellCoord(bounds.max.y);
+    const int32_t minZ = GetCellCoord(bounds.min.z), maxZ = GetCellCoord(bounds.max.z);
+    if (maxX < minX || maxY < minY || maxZ < minZ) {
+        return;
+    }
+
+    // When the bounds cover more cells than are occupied, walk the occupied cells instead.
+    const uint64_t rangeCount = static_cast<uint64_t>(maxX - minX + 1) * static_cast<uint64_t>(maxY - minY + 1) * static_cast<uint64_t>(maxZ - minZ + 1);
+    if (rangeCount > GetCellCount()) {
+        for (const auto& shard : m_shards) {
+            for (const auto& cell : shard.cells) {
+                const int32_t x = GetKeyCoord(cell.first, 2 * c_cellCoordBits);
+                const int32_t y = GetKeyCoord(cell.first, c_cellCoordBits);
+                const int32_t z = GetKeyCoord(cell.first, 0);
+                if (x >= minX && x <= maxX && y >= minY && y <= maxY && z >= minZ && z <= maxZ) {
+                    func(cell.second);
+                }
+            }
+        }
+        return;
+    }
+
+    for (int32_t z = minZ; z <= maxZ; ++z) {
+        for (int32_t y = minY; y <= maxY; ++y) {
+            for (int32_t x = minX; x <= maxX; ++x) {
+                const CellKey key = GetCellKey(x, y, z);
+                const auto& cells = m_shards[GetShard(key)].cells;
+                auto cellIter = cells.find(key);
+                if (cellIter != cells.cend()) {
+                    func(cellIter->second);
+                }
+            }
+        }
+    }
+}
+
+}
\ No newline at end of file